@@ -2,36 +2,212 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include "discoveryPlugin.h"
+#include "nodeContext.h"
 
 #include "pxr/base/tf/diagnostic.h"
 #include "pxr/base/tf/fileUtils.h"
 #include "pxr/base/tf/stringUtils.h"
 #include "pxr/base/tf/envSetting.h"
 #include "pxr/base/tf/pathUtils.h"
+#include "pxr/base/work/detachedTask.h"
+#include "pxr/base/work/loops.h"
 
 #include "pxr/usd/ar/resolver.h"
 #include "pxr/usd/ar/resolverScopedCache.h"
 
 #include "pxr/usd/ndr/debugCodes.h"
 
+#include <fstream>
+#include <memory>
+
+#include <fcntl.h>
+#include <unistd.h>
+
 PXR_NAMESPACE_OPEN_SCOPE
 
+TF_DEFINE_ENV_SETTING(MOONRAY_CLASS_SNIFF_CONTEXT, false,
+                      "Scan each Moonray class definition for its type during "
+                      "discovery, and report the matching Sdr context as the "
+                      "node family.");
+
+TF_DEFINE_ENV_SETTING(MOONRAY_CLASS_ALLOWLIST, "",
+                      "List of Moonray class names (separated by ':', ',' or "
+                      "whitespace). If set, only these classes are discovered.");
+
+TF_DEFINE_ENV_SETTING(MOONRAY_CLASS_ALLOWLIST_FILE, "",
+                      "File listing the Moonray class names to discover, one "
+                      "or more per line. Lines starting with '#' are ignored.");
+
+TF_DEFINE_ENV_SETTING(MOONRAY_CLASS_ALLOWLIST_FALLBACK, false,
+                      "Also search the subdirectories of each search path for "
+                      "allowed classes that are not at its top level.");
+
+TF_DEFINE_ENV_SETTING(MOONRAY_CLASS_PREFETCH, false,
+                      "Start reading the discovered Moonray class definitions "
+                      "in the background, ahead of parsing. Requires an "
+                      "allowlist.");
+
 TfToken moonrayNodeType("moonrayClass");
 
 namespace {
 
+// Find the "type" of a class in a Moonray class definition file, without
+// parsing the whole file. The file is scanned in small chunks, keeping
+// only the keys of the enclosing objects, and the scan stops as soon as
+// the type has been read or the class object has been closed. Class
+// dumps sort their keys, so "type" usually follows "attributes" and
+// "grouping" and most of the file is read : those values are skipped by
+// matching brackets and quotes only, without tracking keys or copying
+// strings, which is still much cheaper than building the JSON DOM.
+bool sniffClassType(const std::string& path,
+                    const std::string& className,
+                    std::string* classType)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (ifs.fail()) {
+        return false;
+    }
+
+    // most recent key in each open object/array, outermost first
+    std::vector<std::string> keys;
+    std::string str;
+    bool inString = false;
+    bool escaped = false;
+    bool wantType = false;
+    // nesting depth inside a skipped class member, 0 if not skipping
+    int skipDepth = 0;
+
+    auto inClass = [&keys, &className]() {
+        return keys.size() == 3 &&
+            keys[0] == "scene_classes" && keys[1] == className;
+    };
+
+    char buf[65536];
+    while (ifs.read(buf, sizeof(buf)) || ifs.gcount() > 0) {
+        const std::streamsize count = ifs.gcount();
+        for (std::streamsize i = 0; i < count; ++i) {
+            const char c = buf[i];
+            if (inString) {
+                if (escaped) {
+                    escaped = false;
+                } else if (c == '\\') {
+                    escaped = true;
+                    continue;
+                } else if (c == '"') {
+                    inString = false;
+                    if (wantType && skipDepth == 0) {
+                        *classType = str;
+                        return true;
+                    }
+                    continue;
+                }
+                // strings nested below the class keys are never needed
+                if (skipDepth == 0 && keys.size() <= 3) str.push_back(c);
+                continue;
+            }
+            if (skipDepth > 0) {
+                if (c == '"') {
+                    inString = true;
+                } else if (c == '{' || c == '[') {
+                    ++skipDepth;
+                } else if (c == '}' || c == ']') {
+                    --skipDepth;
+                }
+                continue;
+            }
+            switch (c) {
+            case '"':
+                inString = true;
+                str.clear();
+                break;
+            case ':':
+                if (!keys.empty()) keys.back() = str;
+                wantType = inClass() && str == "type";
+                break;
+            case '{':
+            case '[':
+                wantType = false;
+                if (inClass()) {
+                    // a class member other than the type (e.g. the
+                    // attributes) : skip the whole value
+                    skipDepth = 1;
+                    break;
+                }
+                keys.emplace_back();
+                break;
+            case '}':
+            case ']':
+                if (inClass()) {
+                    // reached the end of the class without finding a type
+                    return false;
+                }
+                if (!keys.empty()) keys.pop_back();
+                break;
+            case ',':
+                wantType = false;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    return false;
+}
+
+// Read the class allowlist from the environment, either as a list
+// of names or from a file (e.g. listing the info:id of every shader
+// used by a stage). Both may be given. Returns true if either is set :
+// only the allowed classes are then discovered, even if the list is
+// empty or the file cannot be read. Returns false if neither is set, in
+// which case every class is discovered
+bool loadAllowlist(NdrStringSet* allowedNames)
+{
+    const std::string& names = TfGetEnvSetting(MOONRAY_CLASS_ALLOWLIST);
+    const std::string& fileName = TfGetEnvSetting(MOONRAY_CLASS_ALLOWLIST_FILE);
+    for (const std::string& name : TfStringTokenize(names, ":, \t\n")) {
+        allowedNames->insert(name);
+    }
+
+    if (!fileName.empty()) {
+        std::ifstream ifs(fileName);
+        if (ifs.fail()) {
+            TF_WARN("Could not open the Moonray class allowlist [%s]. "
+                    "Its classes will not be discovered.", fileName.c_str());
+            return true;
+        }
+        std::string line;
+        while (std::getline(ifs, line)) {
+            line = TfStringTrim(line);
+            if (line.empty() || line[0] == '#') continue;
+            for (const std::string& name : TfStringTokenize(line, ", \t")) {
+                allowedNames->insert(name);
+            }
+        }
+    }
+
+    return !names.empty() || !fileName.empty();
+}
+
 bool examineFiles(NdrNodeDiscoveryResultVec* foundNodes,
                   NdrStringSet* foundNames,
                   const NdrDiscoveryPluginContext* context,
+                  bool sniffContext,
+                  const NdrStringSet* allowedNames,
                   const std::string& dirPath,
                   const NdrStringVec& dirFileNames)
 {
     for (const std::string& fileName : dirFileNames) {
         std::string extension = TfStringToLower(TfGetExtension(fileName));
         if (extension == "json") {
-            std::string uri = TfStringCatPaths(dirPath, fileName);
             std::string className = TfStringGetBeforeSuffix(fileName, '.');
 
+            // check the allowlist before doing any resolver work
+            if (allowedNames && allowedNames->count(className) == 0) {
+                continue;
+            }
+
+            std::string uri = TfStringCatPaths(dirPath, fileName);
+
             if (!foundNames->insert(className).second) {
                  TF_DEBUG(NDR_DISCOVERY).Msg(
                      "Duplicate moonray class [%s] found at URI [%s], ignoring.",
@@ -39,15 +215,31 @@ bool examineFiles(NdrNodeDiscoveryResultVec* foundNodes,
                 continue;
             }
 
+            const std::string resolvedUri = ArGetResolver().Resolve(uri);
+
+            // the family is set to the node context, so that hosts can
+            // select nodes by context without parsing them
+            TfToken family;
+            if (sniffContext) {
+                std::string classType;
+                if (sniffClassType(resolvedUri, className, &classType)) {
+                    family = MoonrayGetNodeContext(classType);
+                } else {
+                    TF_DEBUG(NDR_DISCOVERY).Msg(
+                        "Could not find the type of moonray class [%s] at URI [%s].",
+                        className.c_str(), resolvedUri.c_str());
+                }
+            }
+
             foundNodes->emplace_back(
                 NdrIdentifier(className),          // Identifier
                 NdrVersion().GetAsDefault(),       // Version
                 className,                         // Name
-                TfToken(),                         // Family
+                family,                            // Family
                 moonrayNodeType,                   // DiscoveryType
                 moonrayNodeType,                   // SourceType
                 uri,
-                ArGetResolver().Resolve(uri)
+                resolvedUri
             );
         }
     }
@@ -55,30 +247,57 @@ bool examineFiles(NdrNodeDiscoveryResultVec* foundNodes,
     // Continue walking directories
     return true;
 }
-} // namespace {
 
-const NdrStringVec&
-MoonrayDiscoveryPlugin::GetSearchURIs() const
+// Bring a class definition file into the page cache, so that it can be
+// read without waiting on the filesystem when the node is parsed
+void prefetchFile(const std::string& path)
 {
-    return _searchPaths;
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+#if defined(__linux__)
+    // starts an asynchronous read of the whole file
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#else
+    char buf[65536];
+    while (read(fd, buf, sizeof(buf)) > 0) {}
+#endif
+    close(fd);
 }
 
-MoonrayDiscoveryPlugin::MoonrayDiscoveryPlugin()
+// Prefetch the definitions of the discovered nodes without blocking
+// discovery. The files are opened in parallel, so that the round trips
+// to a network filesystem overlap instead of being paid one at a time
+// by the parser.
+void prefetchNodes(const NdrNodeDiscoveryResultVec& foundNodes)
 {
-    const char* env = std::getenv("MOONRAY_CLASS_PATH");
-    if (env) {
-        _searchPaths = TfStringSplit(env, ":");
+    auto paths = std::make_shared<NdrStringVec>();
+    paths->reserve(foundNodes.size());
+    for (const NdrNodeDiscoveryResult& node : foundNodes) {
+        paths->push_back(node.resolvedUri);
     }
+
+    WorkRunDetachedTask([paths]() {
+        WorkParallelForN(
+            paths->size(),
+            [&paths](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    prefetchFile((*paths)[i]);
+                }
+            },
+            /* grainSize = */ 8);
+    });
 }
 
-NdrNodeDiscoveryResultVec
-MoonrayDiscoveryPlugin::DiscoverNodes(const Context& context)
+void walkSearchPaths(NdrNodeDiscoveryResultVec* foundNodes,
+                     NdrStringSet* foundNames,
+                     const NdrDiscoveryPluginContext* context,
+                     bool sniffContext,
+                     const NdrStringSet* allowedNames,
+                     const NdrStringVec& searchPaths)
 {
-    NdrNodeDiscoveryResultVec foundNodes;
-    NdrStringSet foundNames;
-    ArResolverScopedCache resolverCache;
-
-    for (const std::string& searchPath : _searchPaths) {
+    for (const std::string& searchPath : searchPaths) {
 
         if (!TfIsDir(searchPath)) {
             continue;
@@ -88,9 +307,11 @@ MoonrayDiscoveryPlugin::DiscoverNodes(const Context& context)
             searchPath,
             std::bind(
                 &examineFiles,
-                &foundNodes,
-                &foundNames,
-                &context,
+                foundNodes,
+                foundNames,
+                context,
+                sniffContext,
+                allowedNames,
                 std::placeholders::_1,
                 std::placeholders::_3
             ),
@@ -99,6 +320,104 @@ MoonrayDiscoveryPlugin::DiscoverNodes(const Context& context)
             /* followSymlinks = */ true
         );
     }
+}
+
+// Selective discovery : the cost scales with the number of allowed
+// classes rather than the size of the class library. The search paths
+// are still searched in order, so the same file is found for a class
+// as when discovering everything
+void discoverAllowedNodes(NdrNodeDiscoveryResultVec* foundNodes,
+                          NdrStringSet* foundNames,
+                          const NdrDiscoveryPluginContext* context,
+                          bool sniffContext,
+                          const NdrStringSet& allowedNames,
+                          const NdrStringVec& searchPaths)
+{
+    const bool fallback = TfGetEnvSetting(MOONRAY_CLASS_ALLOWLIST_FALLBACK);
+
+    for (const std::string& searchPath : searchPaths) {
+        if (foundNames->size() == allowedNames.size()) {
+            break;
+        }
+
+        // Classes are normally at the top level of a search path, so look
+        // for them there directly instead of walking the directories.
+        // Unlike the walk, this only finds files with a lowercase
+        // ".json" extension
+        NdrStringSet missingNames;
+        NdrStringVec fileNames;
+        for (const std::string& name : allowedNames) {
+            if (foundNames->count(name) == 0) {
+                std::string fileName = name + ".json";
+                if (TfIsFile(TfStringCatPaths(searchPath, fileName),
+                             /* resolveSymlinks = */ true)) {
+                    fileNames.push_back(std::move(fileName));
+                } else {
+                    missingNames.insert(name);
+                }
+            }
+        }
+        examineFiles(foundNodes, foundNames, context, sniffContext,
+                     &allowedNames, searchPath, fileNames);
+
+        if (fallback && !missingNames.empty()) {
+            // walk this search path, only for the classes that
+            // are still missing, before moving on to the next one
+            walkSearchPaths(foundNodes, foundNames, context, sniffContext,
+                            &missingNames, NdrStringVec(1, searchPath));
+        }
+    }
+
+    for (const std::string& name : allowedNames) {
+        if (foundNames->count(name) == 0) {
+            TF_DEBUG(NDR_DISCOVERY).Msg(
+                "Allowed moonray class [%s] was not found.", name.c_str());
+        }
+    }
+}
+} // namespace {
+
+const NdrStringVec&
+MoonrayDiscoveryPlugin::GetSearchURIs() const
+{
+    return _searchPaths;
+}
+
+MoonrayDiscoveryPlugin::MoonrayDiscoveryPlugin()
+{
+    const char* env = std::getenv("MOONRAY_CLASS_PATH");
+    if (env) {
+        _searchPaths = TfStringSplit(env, ":");
+    }
+    _selective = loadAllowlist(&_allowedNames);
+}
+
+NdrNodeDiscoveryResultVec
+MoonrayDiscoveryPlugin::DiscoverNodes(const Context& context)
+{
+    NdrNodeDiscoveryResultVec foundNodes;
+    NdrStringSet foundNames;
+    ArResolverScopedCache resolverCache;
+    const bool sniffContext = TfGetEnvSetting(MOONRAY_CLASS_SNIFF_CONTEXT);
+
+    if (!_selective) {
+        walkSearchPaths(&foundNodes, &foundNames, &context, sniffContext,
+                        nullptr, _searchPaths);
+    } else {
+        discoverAllowedNodes(&foundNodes, &foundNames, &context, sniffContext,
+                             _allowedNames, _searchPaths);
+    }
+
+    if (TfGetEnvSetting(MOONRAY_CLASS_PREFETCH)) {
+        if (!_selective) {
+            // the registry only parses the nodes it is asked for :
+            // prefetching would read the whole class library
+            TF_WARN("MOONRAY_CLASS_PREFETCH is ignored without a Moonray class "
+                    "allowlist (MOONRAY_CLASS_ALLOWLIST or MOONRAY_CLASS_ALLOWLIST_FILE).");
+        } else {
+            prefetchNodes(foundNodes);
+        }
+    }
 
     return foundNodes;
 }
@@ -26,6 +26,9 @@ public:
 
 private:
     NdrStringVec _searchPaths;
+    // if an allowlist is set, only these classes are discovered
+    bool _selective = false;
+    NdrStringSet _allowedNames;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
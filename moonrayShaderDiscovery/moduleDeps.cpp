@@ -15,7 +15,8 @@ TF_REGISTRY_FUNCTION(TfScriptModuleLoader) {
     const std::vector<TfToken> reqs = {
         TfToken("ar"),
         TfToken("ndr"),
-        TfToken("sdr")
+        TfToken("sdr"),
+        TfToken("work")
     };
     TfScriptModuleLoader::GetInstance().
         RegisterLibrary(TfToken("moonrayShaderDiscovery"), TfToken("pxr.MoonrayShaderDiscovery"), reqs);
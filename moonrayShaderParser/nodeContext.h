@@ -0,0 +1,35 @@
+// Copyright 2023-2024 DreamWorks Animation LLC
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef PXR_USD_PLUGIN_MOONRAY_NODE_CONTEXT_H
+#define PXR_USD_PLUGIN_MOONRAY_NODE_CONTEXT_H
+
+#include "pxr/pxr.h"
+#include "pxr/base/tf/token.h"
+
+#include "pxr/usd/sdr/shaderNode.h"
+
+#include <string>
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// Map the "type" of a Moonray scene class to the node contexts defined
+// in SdrNode.h. Shared by the discovery plugin (which can sniff the type
+// to set the node family) and the parser plugin, so both agree.
+inline TfToken
+MoonrayGetNodeContext(const std::string& nodeType)
+{
+    // map supported types to those defined in SdrNode.h
+    if (nodeType == "Material") return SdrNodeContext->Surface;
+    if (nodeType == "Volume") return SdrNodeContext->Volume;
+    if (nodeType == "Map") return SdrNodeContext->Pattern;
+    if (nodeType == "Light") return SdrNodeContext->Light;
+    if (nodeType == "LightFilter") return SdrNodeContext->LightFilter;
+    if (nodeType == "Displacement") return SdrNodeContext->Displacement;
+    // otherwise use the moonray name directly
+    return TfToken(nodeType);
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
+
+#endif
@@ -2,7 +2,9 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include "parserPlugin.h"
+#include "nodeContext.h"
 
+#include "pxr/base/tf/denseHashMap.h"
 #include "pxr/base/tf/staticTokens.h"
 #include "pxr/base/js/value.h"
 #include "pxr/base/js/json.h"
@@ -24,6 +26,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <string_view>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
@@ -31,6 +34,22 @@ namespace {
 
 TfToken nullSceneObjectPtr;
 
+// tokens shared by every property, so they are only created once
+TF_DEFINE_PRIVATE_TOKENS(
+    _propertyTokens,
+
+    ((trueValue, "true"))
+    ((falseValue, "false"))
+    ((fileInput, "fileInput"))
+    ((out, "out"))
+);
+
+// attribute name -> group name. Both strings are borrowed
+// from the JSON definition, which outlives the map
+using AttrGroupMap = TfDenseHashMap<std::string_view,
+                                    const std::string*,
+                                    std::hash<std::string_view>>;
+
 // Get the most specific available SdrPropertyType token for an RDL type.
 // We can also return a fixed array size : in some cases
 // SdrProperty will internally map an array to a single Sdf type
@@ -176,21 +195,12 @@ VtValue convertVector(const JsValue& val,
 bool isDynamicVector(const std::string& type)
 {
     return (type.size() > 6) &&
-        (type.substr(type.size()-6,std::string::npos) == "Vector");
+        (type.compare(type.size()-6, 6, "Vector") == 0);
 }
 
 const TfToken getNodeContext(const JsObject& definition)
 {
-    std::string nodeType = definition.at("type").GetString();
-    // map supported types to those defined in SdrNode.h
-    if (nodeType == "Material") return SdrNodeContext->Surface;
-    if (nodeType == "Volume") return SdrNodeContext->Volume;
-    if (nodeType == "Map") return SdrNodeContext->Pattern;
-    if (nodeType == "Light") return SdrNodeContext->Light;
-    if (nodeType == "LightFilter") return SdrNodeContext->LightFilter;
-    if (nodeType == "Displacement") return SdrNodeContext->Displacement;
-    // otherwise use the moonray name directly
-    return TfToken(nodeType);
+    return MoonrayGetNodeContext(definition.at("type").GetString());
 }
 
 NdrTokenMap getNodeMetadata(const NdrTokenMap &baseMetadata,
@@ -203,11 +213,11 @@ NdrTokenMap getNodeMetadata(const NdrTokenMap &baseMetadata,
 SdrShaderProperty* makeOutputProperty(const std::string& nodeType)
 {
     if (nodeType == "Material" || nodeType == "Volume") {
-        return new SdrShaderProperty(TfToken("out"), SdrPropertyTypes->Terminal, VtValue(TfToken()),
+        return new SdrShaderProperty(_propertyTokens->out, SdrPropertyTypes->Terminal, VtValue(TfToken()),
                                      true, 0, NdrTokenMap(), NdrTokenMap(), NdrOptionVec());
     }
     if (nodeType == "Map" || nodeType == "Displacement") {
-        return new SdrShaderProperty(TfToken("out"), SdrPropertyTypes->Float, VtValue(GfVec3f(0,0,0)),
+        return new SdrShaderProperty(_propertyTokens->out, SdrPropertyTypes->Float, VtValue(GfVec3f(0,0,0)),
                                      true, 3, NdrTokenMap(), NdrTokenMap(), NdrOptionVec());
     }
     return nullptr;
@@ -218,29 +228,45 @@ getNodeProperties(const NdrNodeDiscoveryResult& discoveryResult,
                   const JsObject& definition)
 {
     // groups are defined by listing the attributes in them : we need
-    // the inverse map to get the group for each attribute
-    std::map<std::string,std::string> attrNameToGroup;
-    try {  // sometimes no grouping is defined
-         const JsObject& groups = definition.at("grouping").GetJsObject().at("groups").GetJsObject();
-        for (const auto& group : groups) {
-            const std::string& groupName = group.first;
-            std::vector<std::string> attrsInGroup = group.second.GetArrayOf<std::string>();
-            for (const std::string& attrName : attrsInGroup) {
-                attrNameToGroup[attrName] = groupName;
+    // the inverse map to get the group for each attribute.
+    // sometimes no grouping is defined
+    AttrGroupMap attrNameToGroup;
+    auto groupingIt = definition.find("grouping");
+    if (groupingIt != definition.end() && groupingIt->second.IsObject()) {
+        const JsObject& grouping = groupingIt->second.GetJsObject();
+        auto groupsIt = grouping.find("groups");
+        if (groupsIt != grouping.end() && groupsIt->second.IsObject()) {
+            for (const auto& group : groupsIt->second.GetJsObject()) {
+                const std::string& groupName = group.first;
+                if (!group.second.IsArray()) continue;
+                for (const JsValue& attrName : group.second.GetJsArray()) {
+                    if (attrName.IsString()) {
+                        attrNameToGroup[attrName.GetString()] = &groupName;
+                    }
+                }
             }
         }
-    } catch (std::out_of_range&) {
-        // no grouping data is ok
     }
 
-    size_t numAttributes = 0;
-    JsObject attributes;
-    if (!definition.at("attributes").IsNull()) {
-        // it is possible for a shader to have no attributes
-        attributes = definition.at("attributes").GetJsObject();
-        numAttributes = attributes.size();
-    }
-    NdrPropertyUniquePtrVec properties(numAttributes);
+    // it is possible for a shader to have no attributes
+    static const JsObject noAttributes;
+    const JsValue& attributesValue = definition.at("attributes");
+    const JsObject& attributes = attributesValue.IsNull() ?
+        noAttributes : attributesValue.GetJsObject();
+    // leave room for the output, which is appended last
+    NdrPropertyUniquePtrVec properties;
+    properties.reserve(attributes.size() + 1);
+    properties.resize(attributes.size());
+
+    // reused for every attribute, since SdrShaderProperty takes its own
+    // copy. clear() frees the map nodes, so only the bucket array and the
+    // options storage are actually reused : each metadata entry is still
+    // an allocation. An arena can't help, since SdrShaderProperty only
+    // accepts an NdrTokenMap using the standard allocator
+    NdrTokenMap metadata;
+    // we don't have any additional UI hints
+    const NdrTokenMap hints;
+    NdrOptionVec options;
 
     for (const auto& attribute : attributes) {
         const std::string& attrName = attribute.first;
@@ -254,7 +280,7 @@ getNodeProperties(const NdrNodeDiscoveryResult& discoveryResult,
 
         VtValue propDefault = convertDefault(attrDefault,attrType);
 
-        NdrTokenMap metadata;
+        metadata.clear();
         auto mdIt = attrData.find("metadata");
         if (mdIt != attrData.end()) {
             const JsObject& attrMetadata = mdIt->second.GetJsObject();
@@ -267,36 +293,33 @@ getNodeProperties(const NdrNodeDiscoveryResult& discoveryResult,
         // "page" metadata is set from group name
         auto groupIt = attrNameToGroup.find(attrName);
         if (groupIt != attrNameToGroup.end()) {
-            metadata[SdrPropertyMetadata->Page] = groupIt->second;
+            metadata[SdrPropertyMetadata->Page] = *groupIt->second;
         }
 
         if (isDynamicVector(attrType))
-            metadata[SdrPropertyMetadata->IsDynamicArray] = TfToken("true");
+            metadata[SdrPropertyMetadata->IsDynamicArray] = _propertyTokens->trueValue;
 
         auto bindIt = attrData.find("bindable");
         if (bindIt != attrData.end() &&
             bindIt->second.GetBool()) {
-            metadata[SdrPropertyMetadata->Connectable] = TfToken("true");
+            metadata[SdrPropertyMetadata->Connectable] = _propertyTokens->trueValue;
         } else {
             // default is connectable, so must set to false if it isn't
-            metadata[SdrPropertyMetadata->Connectable] = TfToken("false");
+            metadata[SdrPropertyMetadata->Connectable] = _propertyTokens->falseValue;
         }
  
         auto fileIt = attrData.find("filename");
         if (fileIt != attrData.end() &&
             fileIt->second.GetBool()) {
-            metadata[SdrPropertyMetadata->IsAssetIdentifier] = TfToken("true");
+            metadata[SdrPropertyMetadata->IsAssetIdentifier] = _propertyTokens->trueValue;
             // probably a bug : shaderMetadataHelpers.cpp identifies assets
             // using the Widget metadata instead of "IsAssetIdentifier".
             // without this, the default value will not be correctly conformed to
             // an SdfAssetPath
-            metadata[SdrPropertyMetadata->Widget] = TfToken("fileInput");
+            metadata[SdrPropertyMetadata->Widget] = _propertyTokens->fileInput;
         }
 
-        // we don't have any additional UI hints
-        NdrTokenMap hints;
-
-        NdrOptionVec options;
+        options.clear();
         auto enumIt = attrData.find("enum");
         if (enumIt != attrData.end()) {
             // type for an enum should be string (per Usd), not int (per RDL)
@@ -304,6 +327,7 @@ getNodeProperties(const NdrNodeDiscoveryResult& discoveryResult,
             // we will also need to update propDefault...
             int dfltInt = propDefault.Get<int>();
             const JsObject& enumItems = enumIt->second.GetJsObject();
+            options.reserve(enumItems.size());
             for (const auto& option : enumItems) {
                 // RDL enums have int values, whereas Sdr
                 // uses strings, so we have to leave it to the shader
@@ -337,6 +361,27 @@ getNodeProperties(const NdrNodeDiscoveryResult& discoveryResult,
     return properties;
 }
 
+// Read a whole file with a single read into a buffer sized up front.
+// JsParseStream would copy the stream one character at a time,
+// and the file may already be in the page cache if discovery
+// prefetched it
+bool readFile(const std::string& path, std::string* contents)
+{
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+    if (ifs.fail()) {
+        return false;
+    }
+    const std::streamoff size = ifs.tellg();
+    if (size < 0) {
+        return false;
+    }
+    contents->resize(static_cast<size_t>(size));
+    ifs.seekg(0);
+    ifs.read(&(*contents)[0], size);
+    contents->resize(static_cast<size_t>(ifs.gcount()));
+    return !ifs.bad();
+}
+
 } // namespace {
 
 NDR_REGISTER_PARSER_PLUGIN(MoonrayParserPlugin);
@@ -387,8 +432,8 @@ MoonrayParserPlugin::Parse(const NdrNodeDiscoveryResult& discoveryResult)
 #endif
 
     // load the json file
-    std::ifstream ifs(discoveryResult.resolvedUri);
-    if (ifs.fail()) {
+    std::string contents;
+    if (!readFile(discoveryResult.resolvedUri, &contents)) {
         TF_WARN("Could not open the Moonray shader definition at URI [%s]. ",
                 discoveryResult.resolvedUri.c_str());
         return NdrParserPlugin::GetInvalidNode(discoveryResult);
@@ -396,7 +441,7 @@ MoonrayParserPlugin::Parse(const NdrNodeDiscoveryResult& discoveryResult)
 
     try {
         JsParseError error;
-        JsValue jsDef = JsParseStream(ifs,&error);
+        JsValue jsDef = JsParseString(contents,&error);
         if (jsDef.IsNull()) {
             TF_WARN("JSON error parsing Moonray shader definition at URI [%s]: line %d col %d : %s",
                     discoveryResult.resolvedUri.c_str(),
@@ -0,0 +1,1066 @@
+// Copyright 2023-2024 DreamWorks Animation LLC
+// SPDX-License-Identifier: Apache-2.0
+
+/// @file sdr_verify.cc
+
+// Check that the moonray Sdr plugins produce exactly the same shader
+// nodes as the reference (JsParseStream-based) parser, and compare the
+// throughput of both on the same class definitions. Any faster parsing
+// path must pass this check before it is deployed.
+
+#include <pxr/base/arch/fileSystem.h>
+#include <pxr/base/plug/plugin.h>
+#include <pxr/base/plug/registry.h>
+#include <pxr/base/tf/fileUtils.h>
+#include <pxr/base/tf/stringUtils.h>
+#include <pxr/base/js/json.h>
+#include <pxr/base/js/value.h>
+#include <pxr/base/gf/vec2f.h>
+#include <pxr/base/gf/vec2d.h>
+#include <pxr/base/gf/vec3f.h>
+#include <pxr/base/gf/vec3d.h>
+#include <pxr/base/gf/vec4f.h>
+#include <pxr/base/gf/vec4d.h>
+#include <pxr/base/gf/matrix4f.h>
+#include <pxr/base/gf/matrix4d.h>
+#include <pxr/base/vt/value.h>
+#include <pxr/base/vt/array.h>
+#include <pxr/usd/sdf/valueTypeName.h>
+#include <pxr/usd/ndr/discoveryPlugin.h>
+#include <pxr/usd/ndr/nodeDiscoveryResult.h>
+#include <pxr/usd/ndr/parserPlugin.h>
+#include <pxr/usd/sdr/shaderNode.h>
+#include <pxr/usd/sdr/shaderProperty.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+using namespace pxr;
+
+// Count every allocation made in the process, so that the backends
+// can be compared on allocations per class as well as time
+std::atomic<size_t> allocCount(0);
+
+void* operator new(size_t size)
+{
+    ++allocCount;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace reference {
+
+// The reference parser : this is the moonray parser plugin as it was
+// before any optimization, and must be kept unchanged. The plugin has
+// to produce exactly the same nodes.
+
+TfToken nullSceneObjectPtr;
+
+// Get the most specific available SdrPropertyType token for an RDL type.
+// We can also return a fixed array size : in some cases
+// SdrProperty will internally map an array to a single Sdf type
+// (e.g. float[2] will map to float2)
+std::pair<TfToken,  // SdrPropertyType
+          size_t>   // array size
+getSdrTypeAndSize(const std::string& attrType)
+{
+    // The rdl "vector" types are dynamic arrays, and therefore
+    // get the same conversion as the base type. The metadata
+    // value SdrPropertyMetadata->IsDynamicArray will mark
+    // them as dynamic arrays
+
+    if (attrType == "Bool" || attrType == "BoolVector" ||
+        attrType == "Int" || attrType == "IntVector" ||
+        attrType == "Long" || attrType == "LongVector") {
+        return std::pair<TfToken,size_t>(SdrPropertyTypes->Int,0);
+    }
+    if (attrType == "Float" || attrType == "FloatVector" ||
+        attrType == "Double" || attrType == "DoubleVector") {
+        return std::pair<TfToken,size_t>(SdrPropertyTypes->Float,0);
+    }
+    if (attrType == "String" || attrType == "StringVector") {
+        return std::pair<TfToken,size_t>(SdrPropertyTypes->String,0);
+    }
+    if (attrType == "Rgb" || attrType == "RgbVector") {
+        return std::pair<TfToken,size_t>(SdrPropertyTypes->Float,3);
+    }
+    if (attrType == "Rgba" || attrType == "RgbaVector") {
+        return std::pair<TfToken,size_t>(SdrPropertyTypes->Float,4);
+     }
+    if (attrType == "Vec2f" || attrType == "Vec2fVector" ||
+        attrType == "Vec2d" || attrType == "Vec2dVector") {
+        return std::pair<TfToken,size_t>(SdrPropertyTypes->Float,2);
+    }
+    if (attrType == "Vec3f" || attrType == "Vec3fVector" ||
+        attrType == "Vec3d" || attrType == "Vec3dVector") {
+        return std::pair<TfToken,size_t>(SdrPropertyTypes->Float,3);
+    }
+    if (attrType == "Vec4f" || attrType == "Vec4fVector" ||
+        attrType == "Vec4d" || attrType == "Vec4dVector") {
+        return std::pair<TfToken,size_t>(SdrPropertyTypes->Float,4);
+    }
+    if (attrType == "Mat4f" || attrType == "Mat4fVector" ||
+        attrType == "Mat4d" || attrType == "Mat4dVector") {
+        return std::pair<TfToken,size_t>(SdrPropertyTypes->Matrix,0);
+    }
+    return std::pair<TfToken,size_t>(SdrPropertyTypes->Unknown,0);
+}
+
+// Convert a default value in JSON to VtValue
+template <typename T>
+VtValue convertVector(const JsValue& val,
+                      const std::string& baseType);
+VtValue convertDefault(const JsValue& val,
+                       const std::string& attrType)
+{
+    if (attrType == "Bool") return VtValue(val.GetBool() ? 0 : 1);
+    if (attrType == "Int") return VtValue(val.GetInt());
+    if (attrType == "Long") return VtValue(val.GetInt64());
+    if (attrType == "Float") return VtValue((float)val.GetReal());
+    if (attrType == "Double") return VtValue(val.GetReal());
+    if (attrType == "String") return VtValue(val.GetString());
+    if (attrType == "Rgb" || attrType == "Vec3f") {
+        std::vector<double> v = val.GetArrayOf<double>();
+        return VtValue(GfVec3f((float)v.at(0), (float)v.at(1), (float)v.at(2)));
+    }
+    if (attrType == "Rgba" || attrType == "Vec4f") {
+        std::vector<double> v = val.GetArrayOf<double>();
+        return VtValue(GfVec4f((float)v.at(0), (float)v.at(1), (float)v.at(2),(float)v.at(3)));
+    }
+    if (attrType == "Vec2f") {
+        std::vector<double> v = val.GetArrayOf<double>();
+        return VtValue(GfVec2f((float)v.at(0), (float)v.at(1)));
+    }
+    if (attrType == "Vec2d") {
+        std::vector<double> v = val.GetArrayOf<double>();
+        return VtValue(GfVec2d(v.at(0), v.at(1)));
+    }
+    if (attrType == "Vec3d") {
+        std::vector<double> v = val.GetArrayOf<double>();
+        return VtValue(GfVec3d(v.at(0), v.at(1),v.at(2)));
+    }
+    if (attrType == "Vec4d") {
+        std::vector<double> v = val.GetArrayOf<double>();
+        return VtValue(GfVec4d(v.at(0), v.at(1),v.at(2),v.at(3)));
+    }
+    if (attrType == "Mat4f") {
+        std::vector<std::vector<double>> data;
+        const JsArray& arr = val.GetJsArray();
+        for (const JsValue& val : arr) {
+            data.emplace_back(val.GetArrayOf<double>());
+        }
+        return VtValue(GfMatrix4f(data));
+    }
+    if (attrType == "Mat4d") {
+        std::vector<std::vector<double>> data;
+        const JsArray& arr = val.GetJsArray();
+        for (const JsValue& val : arr) {
+            data.emplace_back(val.GetArrayOf<double>());
+        }
+        return VtValue(GfMatrix4d(data));
+    }
+    if (attrType == "SceneObject*") {
+        // can't initialize to anything except null
+        return VtValue(nullSceneObjectPtr);
+    }
+    if (attrType == "BoolVector") return convertVector<int>(val,"Bool");
+    if (attrType == "IntVector") return convertVector<int>(val,"Int");
+    if (attrType == "LongVector") return convertVector<int64_t>(val,"Long");
+    if (attrType == "FloatVector") return convertVector<float>(val,"Float");
+    if (attrType == "DoubleVector") return convertVector<double>(val,"Double");
+    if (attrType == "StringVector") return convertVector<std::string>(val,"String");
+    if (attrType == "RgbVector") return convertVector<GfVec3f>(val,"Rgb");
+    if (attrType == "Vec3fVector") return convertVector<GfVec3f>(val,"Vec3f");
+    if (attrType == "RgbaVector") return convertVector<GfVec3f>(val,"Rgba");
+    if (attrType == "Vec4f") return convertVector<GfVec4f>(val,"Vec4f");
+    if (attrType == "Vec2fVector") return convertVector<GfVec2f>(val,"Vec2f");
+    if (attrType == "Vec2dVector") return convertVector<GfVec2d>(val,"Vec2d");
+    if (attrType == "Vec3dVector") return convertVector<GfVec3d>(val,"Vec3d");
+    if (attrType == "Vec4fVector") return convertVector<GfVec4f>(val,"Vec4f");
+    if (attrType == "Vec4dVector") return convertVector<GfVec4d>(val,"Vec4d");
+    if (attrType == "Mat4fVector") return convertVector<GfMatrix4f>(val,"Mat4f");
+    if (attrType == "Mat4dVector") return convertVector<GfMatrix4d>(val,"Mat4d");
+    if (attrType == "SceneObjectVector" || attrType == "SceneObjectIndexable")
+        return convertVector<TfToken>(val,"SceneObject");
+    return VtValue();
+}
+
+template<typename T>
+VtValue convertVector(const JsValue& val,
+                       const std::string& baseType)
+{
+    VtArray<T> arrayOut;
+    const JsArray& arrayIn = val.GetJsArray();
+    for (const JsValue& elem : arrayIn) {
+        VtValue vtElem = convertDefault(elem,baseType);
+        arrayOut.push_back(vtElem.Get<T>());
+    }
+    return VtValue(arrayOut);
+}
+
+bool isDynamicVector(const std::string& type)
+{
+    return (type.size() > 6) &&
+        (type.substr(type.size()-6,std::string::npos) == "Vector");
+}
+
+const TfToken getNodeContext(const JsObject& definition)
+{
+    std::string nodeType = definition.at("type").GetString();
+    // map supported types to those defined in SdrNode.h
+    if (nodeType == "Material") return SdrNodeContext->Surface;
+    if (nodeType == "Volume") return SdrNodeContext->Volume;
+    if (nodeType == "Map") return SdrNodeContext->Pattern;
+    if (nodeType == "Light") return SdrNodeContext->Light;
+    if (nodeType == "LightFilter") return SdrNodeContext->LightFilter;
+    if (nodeType == "Displacement") return SdrNodeContext->Displacement;
+    // otherwise use the moonray name directly
+    return TfToken(nodeType);
+}
+
+NdrTokenMap getNodeMetadata(const NdrTokenMap &baseMetadata,
+                            const JsObject& definition)
+{
+    // we don't have any special metadata
+    return baseMetadata;
+}
+
+SdrShaderProperty* makeOutputProperty(const std::string& nodeType)
+{
+    if (nodeType == "Material" || nodeType == "Volume") {
+        return new SdrShaderProperty(TfToken("out"), SdrPropertyTypes->Terminal, VtValue(TfToken()),
+                                     true, 0, NdrTokenMap(), NdrTokenMap(), NdrOptionVec());
+    }
+    if (nodeType == "Map" || nodeType == "Displacement") {
+        return new SdrShaderProperty(TfToken("out"), SdrPropertyTypes->Float, VtValue(GfVec3f(0,0,0)),
+                                     true, 3, NdrTokenMap(), NdrTokenMap(), NdrOptionVec());
+    }
+    return nullptr;
+}
+
+NdrPropertyUniquePtrVec
+getNodeProperties(const NdrNodeDiscoveryResult& discoveryResult,
+                  const JsObject& definition)
+{
+    // groups are defined by listing the attributes in them : we need
+    // the inverse map to get the group for each attribute
+    std::map<std::string,std::string> attrNameToGroup;
+    try {  // sometimes no grouping is defined
+         const JsObject& groups = definition.at("grouping").GetJsObject().at("groups").GetJsObject();
+        for (const auto& group : groups) {
+            const std::string& groupName = group.first;
+            std::vector<std::string> attrsInGroup = group.second.GetArrayOf<std::string>();
+            for (const std::string& attrName : attrsInGroup) {
+                attrNameToGroup[attrName] = groupName;
+            }
+        }
+    } catch (std::out_of_range&) {
+        // no grouping data is ok
+    }
+
+    size_t numAttributes = 0;
+    JsObject attributes;
+    if (!definition.at("attributes").IsNull()) {
+        // it is possible for a shader to have no attributes
+        attributes = definition.at("attributes").GetJsObject();
+        numAttributes = attributes.size();
+    }
+    NdrPropertyUniquePtrVec properties(numAttributes);
+
+    for (const auto& attribute : attributes) {
+        const std::string& attrName = attribute.first;
+        const JsObject& attrData = attribute.second.GetJsObject();
+        const std::string& attrType = attrData.at("attrType").GetString();
+        const JsValue& attrDefault = attrData.at("default");
+
+        TfToken sdrType;
+        size_t arraySize;
+        std::tie(sdrType,arraySize) = getSdrTypeAndSize(attrType);
+
+        VtValue propDefault = convertDefault(attrDefault,attrType);
+
+        NdrTokenMap metadata;
+        auto mdIt = attrData.find("metadata");
+        if (mdIt != attrData.end()) {
+            const JsObject& attrMetadata = mdIt->second.GetJsObject();
+            mdIt = attrMetadata.find("label");
+            if (mdIt != attrMetadata.end()) metadata[SdrPropertyMetadata->Label] = mdIt->second.GetString();
+            mdIt = attrMetadata.find("comment");
+            if (mdIt != attrMetadata.end()) metadata[SdrPropertyMetadata->Help] = mdIt->second.GetString();
+        }
+
+        // "page" metadata is set from group name
+        auto groupIt = attrNameToGroup.find(attrName);
+        if (groupIt != attrNameToGroup.end()) {
+            metadata[SdrPropertyMetadata->Page] = groupIt->second;
+        }
+
+        if (isDynamicVector(attrType))
+            metadata[SdrPropertyMetadata->IsDynamicArray] = TfToken("true");
+
+        auto bindIt = attrData.find("bindable");
+        if (bindIt != attrData.end() &&
+            bindIt->second.GetBool()) {
+            metadata[SdrPropertyMetadata->Connectable] = TfToken("true");
+        } else {
+            // default is connectable, so must set to false if it isn't
+            metadata[SdrPropertyMetadata->Connectable] = TfToken("false");
+        }
+ 
+        auto fileIt = attrData.find("filename");
+        if (fileIt != attrData.end() &&
+            fileIt->second.GetBool()) {
+            metadata[SdrPropertyMetadata->IsAssetIdentifier] = TfToken("true");
+            // probably a bug : shaderMetadataHelpers.cpp identifies assets
+            // using the Widget metadata instead of "IsAssetIdentifier".
+            // without this, the default value will not be correctly conformed to
+            // an SdfAssetPath
+            metadata[SdrPropertyMetadata->Widget] = TfToken("fileInput");
+        }
+
+        // we don't have any additional UI hints
+        NdrTokenMap hints;
+
+        NdrOptionVec options;
+        auto enumIt = attrData.find("enum");
+        if (enumIt != attrData.end()) {
+            // type for an enum should be string (per Usd), not int (per RDL)
+            sdrType = SdrPropertyTypes->String;
+            // we will also need to update propDefault...
+            int dfltInt = propDefault.Get<int>();
+            const JsObject& enumItems = enumIt->second.GetJsObject();
+            for (const auto& option : enumItems) {
+                // RDL enums have int values, whereas Sdr
+                // uses strings, so we have to leave it to the shader
+                // implementation to look up the strings...
+                TfToken name(option.first);
+                options.emplace_back(name,name);
+                if (option.second.GetInt() == dfltInt) {
+                    propDefault = VtValue(name.GetText());
+                }
+            }
+        }
+
+        int index = attrData.at("order").GetInt();
+        properties.at(index) = SdrShaderPropertyUniquePtr(
+            new SdrShaderProperty(
+                TfToken(attrName),
+                sdrType,
+                propDefault,
+                false,    // is output
+                arraySize,
+                metadata,
+                hints,
+                options)
+            );
+    }
+
+    SdrShaderProperty *output = makeOutputProperty(definition.at("type").GetString());
+    if (output) {
+        properties.push_back(SdrShaderPropertyUniquePtr(output));
+    }
+    return properties;
+}
+
+
+NdrNodeUniquePtr
+parse(const NdrNodeDiscoveryResult& discoveryResult)
+{
+    std::ifstream ifs(discoveryResult.resolvedUri);
+    if (ifs.fail()) {
+        return NdrParserPlugin::GetInvalidNode(discoveryResult);
+    }
+
+    try {
+        JsParseError error;
+        JsValue jsDef = JsParseStream(ifs,&error);
+        if (jsDef.IsNull()) {
+            return NdrParserPlugin::GetInvalidNode(discoveryResult);
+        }
+
+        const JsObject& definition = jsDef.GetJsObject().at("scene_classes").
+            GetJsObject().at(discoveryResult.name).GetJsObject();
+        return NdrNodeUniquePtr(new SdrShaderNode(
+                                    discoveryResult.identifier,
+                                    discoveryResult.version,
+                                    discoveryResult.name,
+                                    discoveryResult.family,
+                                    getNodeContext(definition),
+                                    discoveryResult.sourceType,
+                                    discoveryResult.uri,
+                                    discoveryResult.resolvedUri,
+                                    getNodeProperties(discoveryResult,definition),
+                                    getNodeMetadata(discoveryResult.metadata,definition),
+                                    discoveryResult.sourceCode));
+    } catch (std::exception&) {
+    }
+    return NdrParserPlugin::GetInvalidNode(discoveryResult);
+}
+
+} // namespace reference
+
+namespace {
+
+const char* TABSTR = "    ";
+
+int usage(const char* prog)
+{
+    std::cout << "Usage:" << std::endl;
+    std::cout << "    " << prog << " [--write-corpus DIR] [--repeat N] [--cold] [CLASS_DIR...]" << std::endl;
+    std::cout << "Parses every class in CLASS_DIR (default: MOONRAY_CLASS_PATH) with the" << std::endl
+              << "reference parser and the moonray Sdr plugins, checks that the nodes are" << std::endl
+              << "identical and reports the throughput of each." << std::endl
+              << "--write-corpus writes class definitions covering every RDL attribute" << std::endl
+              << "type to DIR, and uses them if no CLASS_DIR is given." << std::endl
+              << "--cold also times discovery and parsing from a cold page cache, with" << std::endl
+              << "MOONRAY_CLASS_PREFETCH off and on." << std::endl;
+    return -1;
+}
+
+// ---------------------------------------------------------------------
+// Corpus
+
+struct CorpusAttr {
+    const char* type;
+    const char* dflt;
+};
+
+// every class written to the corpus has a name starting with this
+const std::string corpusPrefix = "Verify";
+
+bool isCorpusClass(const std::string& name)
+{
+    return TfStringStartsWith(name, corpusPrefix);
+}
+
+const char* identity4 = "[[1.0, 0.0, 0.0, 0.0], [0.0, 1.0, 0.0, 0.0], "
+                        "[0.0, 0.0, 1.0, 0.0], [0.0, 0.0, 0.0, 1.0]]";
+
+// every attribute type handled by getSdrTypeAndSize/convertDefault
+const std::vector<CorpusAttr>& allAttrTypes()
+{
+    static const std::vector<CorpusAttr> attrs = {
+        {"Bool", "true"},
+        {"Int", "3"},
+        {"Long", "4"},
+        {"Float", "0.5"},
+        {"Double", "0.25"},
+        {"String", "\"abc\""},
+        {"Rgb", "[0.1, 0.2, 0.3]"},
+        {"Rgba", "[0.1, 0.2, 0.3, 0.4]"},
+        {"Vec2f", "[1.0, 2.0]"},
+        {"Vec2d", "[1.0, 2.0]"},
+        {"Vec3f", "[1.0, 2.0, 3.0]"},
+        {"Vec3d", "[1.0, 2.0, 3.0]"},
+        {"Vec4f", "[1.0, 2.0, 3.0, 4.0]"},
+        {"Vec4d", "[1.0, 2.0, 3.0, 4.0]"},
+        {"Mat4f", identity4},
+        {"Mat4d", identity4},
+        {"SceneObject*", "null"},
+        {"BoolVector", "[true, false]"},
+        {"IntVector", "[1, 2]"},
+        {"LongVector", "[3, 4]"},
+        {"FloatVector", "[0.5, 1.5]"},
+        {"DoubleVector", "[0.25]"},
+        {"StringVector", "[\"a\", \"b\"]"},
+        {"RgbVector", "[[0.1, 0.2, 0.3]]"},
+        {"RgbaVector", "[[0.1, 0.2, 0.3, 0.4]]"},
+        {"Vec2fVector", "[[1.0, 2.0]]"},
+        {"Vec2dVector", "[[1.0, 2.0]]"},
+        {"Vec3fVector", "[[1.0, 2.0, 3.0]]"},
+        {"Vec3dVector", "[[1.0, 2.0, 3.0]]"},
+        {"Vec4fVector", "[[1.0, 2.0, 3.0, 4.0]]"},
+        {"Vec4dVector", "[[1.0, 2.0, 3.0, 4.0]]"},
+        {"Mat4fVector", "[]"},
+        {"Mat4dVector", "[]"},
+        {"SceneObjectVector", "[]"},
+        {"SceneObjectIndexable", "[]"},
+    };
+    return attrs;
+}
+
+std::string attrJson(const std::string& name, const std::string& type,
+                     const std::string& dflt, int order,
+                     const std::string& extra)
+{
+    std::ostringstream os;
+    os << "\"" << name << "\": {\"attrType\": \"" << type << "\", "
+       << "\"default\": " << dflt << ", \"order\": " << order << ", "
+       << "\"metadata\": {\"label\": \"" << name << " label\", "
+       << "\"comment\": \"the " << type << " attribute\"}" << extra << "}";
+    return os.str();
+}
+
+// write one class definition file. If typeLast is true, "type" follows
+// the attributes, so that discovery has to scan past them to find it
+void writeClass(const std::string& dir, const std::string& name,
+                const std::string& type, const std::string& attributes,
+                const std::string& grouping, bool typeLast = false)
+{
+    std::ofstream ofs(TfStringCatPaths(dir, name + ".json"));
+    const std::string typeField = "\"type\": \"" + type + "\"";
+    ofs << "{\"scene_classes\": {\"" << name << "\": {\"name\": \"" << name << "\", ";
+    if (!typeLast) ofs << typeField << ", ";
+    ofs << "\"attributes\": " << attributes;
+    if (!grouping.empty()) ofs << ", \"grouping\": " << grouping;
+    if (typeLast) ofs << ", " << typeField;
+    ofs << "}}}" << std::endl;
+}
+
+bool writeCorpus(const std::string& dir)
+{
+    if (!TfIsDir(dir) && !TfMakeDirs(dir)) {
+        std::cout << "Cannot create corpus directory " << dir << std::endl;
+        return false;
+    }
+
+    // every attribute type, with the bindable and filename flags
+    std::vector<std::string> attrs;
+    const std::vector<CorpusAttr>& types = allAttrTypes();
+    for (size_t i = 0; i < types.size(); ++i) {
+        std::string extra;
+        if (i % 3 == 0) extra += ", \"bindable\": true";
+        if (i % 3 == 1) extra += ", \"bindable\": false";
+        if (std::string(types[i].type) == "String") extra += ", \"filename\": true";
+        attrs.push_back(attrJson(TfStringPrintf("attr%zu_%s", i,
+                                                TfMakeValidIdentifier(types[i].type).c_str()),
+                                 types[i].type, types[i].dflt, static_cast<int>(i), extra));
+    }
+    const std::string allAttrs = "{" + TfStringJoin(attrs, ", ") + "}";
+    writeClass(dir, corpusPrefix + "AllTypesMaterial", "Material", allAttrs, "", true);
+    writeClass(dir, corpusPrefix + "AllTypesMap", "Map", allAttrs, "");
+
+    // enums, including a default that matches no option
+    const std::string enums = "{" +
+        attrJson("mode", "Int", "1", 0,
+                 ", \"enum\": {\"linear\": 0, \"cubic\": 1, \"nearest\": 2}") + ", " +
+        attrJson("fallback", "Int", "7", 1,
+                 ", \"enum\": {\"off\": 0, \"on\": 1}") + ", " +
+        attrJson("map", "String", "\"\"", 2, ", \"filename\": true, \"bindable\": true") + "}";
+    writeClass(dir, corpusPrefix + "EnumLight", "Light", enums, "");
+
+    // groupings, with an ungrouped attribute and an unknown name in a group
+    const std::string grouping =
+        "{\"groups\": {\"Common\": [\"mode\", \"missing\"], \"Texture\": [\"map\"]}}";
+    writeClass(dir, corpusPrefix + "GroupedLightFilter", "LightFilter", enums, grouping);
+    writeClass(dir, corpusPrefix + "EmptyGroupingDisplacement", "Displacement", enums,
+               "{\"groups\": {}}");
+
+    // classes without attributes
+    writeClass(dir, corpusPrefix + "NullAttributesVolume", "Volume", "null", "");
+    writeClass(dir, corpusPrefix + "EmptyAttributesMaterial", "Material", "{}", "");
+
+    // a type without an Sdr context or output
+    writeClass(dir, corpusPrefix + "Geometry", "Geometry", enums, "");
+
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// Comparison
+
+std::string toString(const NdrTokenMap& map)
+{
+    // sorted, since NdrTokenMap is unordered
+    std::map<std::string, std::string> sorted;
+    for (const auto& item : map) {
+        sorted[item.first.GetString()] = item.second;
+    }
+    std::string out;
+    for (const auto& item : sorted) {
+        out += item.first + "=" + item.second + "; ";
+    }
+    return out;
+}
+
+std::string toString(const NdrOptionVec& options)
+{
+    std::string out;
+    for (const auto& option : options) {
+        out += option.first.GetString() + "=" + option.second.GetString() + "; ";
+    }
+    return out;
+}
+
+std::string toString(const NdrTokenVec& tokens)
+{
+    std::string out;
+    for (const TfToken& token : tokens) {
+        out += token.GetString() + "; ";
+    }
+    return out;
+}
+
+class Checker {
+public:
+    explicit Checker(const std::string& nodeName) : _nodeName(nodeName) {}
+
+    template <typename T>
+    void check(const std::string& field, const T& expected, const T& actual)
+    {
+        if (!(expected == actual)) {
+            std::ostringstream os;
+            os << TABSTR << _nodeName << " " << field << std::endl
+               << TABSTR << TABSTR << "expected: " << expected << std::endl
+               << TABSTR << TABSTR << "actual:   " << actual;
+            _mismatches.push_back(os.str());
+        }
+    }
+
+    const std::vector<std::string>& mismatches() const { return _mismatches; }
+
+private:
+    std::string _nodeName;
+    std::vector<std::string> _mismatches;
+};
+
+void compareProperties(const std::string& name,
+                       SdrShaderPropertyConstPtr expected,
+                       SdrShaderPropertyConstPtr actual,
+                       Checker* checker)
+{
+    checker->check(name + " exists", expected != nullptr, actual != nullptr);
+    if (!expected || !actual) return;
+
+    checker->check(name + " type", expected->GetType(), actual->GetType());
+    checker->check(name + " sdf type",
+                   expected->GetTypeAsSdfType().first.GetAsToken(),
+                   actual->GetTypeAsSdfType().first.GetAsToken());
+    checker->check(name + " default", expected->GetDefaultValue(), actual->GetDefaultValue());
+    checker->check(name + " is output", expected->IsOutput(), actual->IsOutput());
+    checker->check(name + " array size", expected->GetArraySize(), actual->GetArraySize());
+    checker->check(name + " is dynamic array", expected->IsDynamicArray(), actual->IsDynamicArray());
+    checker->check(name + " is connectable", expected->IsConnectable(), actual->IsConnectable());
+    checker->check(name + " metadata", toString(expected->GetMetadata()), toString(actual->GetMetadata()));
+    checker->check(name + " hints", toString(expected->GetHints()), toString(actual->GetHints()));
+    checker->check(name + " options", toString(expected->GetOptions()), toString(actual->GetOptions()));
+}
+
+void compareNodes(const NdrNode* expectedNode,
+                  const NdrNode* actualNode,
+                  Checker* checker)
+{
+    checker->check("is valid", expectedNode->IsValid(), actualNode->IsValid());
+
+    const SdrShaderNode* expected = dynamic_cast<const SdrShaderNode*>(expectedNode);
+    const SdrShaderNode* actual = dynamic_cast<const SdrShaderNode*>(actualNode);
+    checker->check("is shader node", expected != nullptr, actual != nullptr);
+    if (!expected || !actual) return;
+
+    checker->check("identifier", expected->GetIdentifier(), actual->GetIdentifier());
+    checker->check("name", expected->GetName(), actual->GetName());
+    checker->check("family", expected->GetFamily(), actual->GetFamily());
+    checker->check("context", expected->GetContext(), actual->GetContext());
+    checker->check("source type", expected->GetSourceType(), actual->GetSourceType());
+    checker->check("metadata", toString(expected->GetMetadata()), toString(actual->GetMetadata()));
+    checker->check("inputs", toString(expected->GetInputNames()), toString(actual->GetInputNames()));
+    checker->check("outputs", toString(expected->GetOutputNames()), toString(actual->GetOutputNames()));
+
+    for (const TfToken& name : expected->GetInputNames()) {
+        compareProperties("input " + name.GetString(),
+                          expected->GetShaderInput(name), actual->GetShaderInput(name),
+                          checker);
+    }
+    for (const TfToken& name : expected->GetOutputNames()) {
+        compareProperties("output " + name.GetString(),
+                          expected->GetShaderOutput(name), actual->GetShaderOutput(name),
+                          checker);
+    }
+}
+
+// ---------------------------------------------------------------------
+// Plugins
+
+class VerifyDiscoveryContext : public NdrDiscoveryPluginContext {
+public:
+    TfToken GetSourceType(const TfToken& discoveryType) const override
+    {
+        return discoveryType;
+    }
+};
+
+// create a plugin instance the same way the Ndr registry does
+template <typename FactoryBase>
+FactoryBase* findPluginFactory(const TfType& baseType, const std::string& typeName)
+{
+    const TfType type = PlugRegistry::FindDerivedTypeByName(baseType, typeName);
+    PlugPluginPtr plugin = PlugRegistry::GetInstance().GetPluginForType(type);
+    if (!plugin || !plugin->Load()) {
+        std::cout << "Cannot load the plugin for " << typeName << std::endl;
+        return nullptr;
+    }
+    FactoryBase* factory = type.GetFactory<FactoryBase>();
+    if (!factory) {
+        std::cout << "No factory for " << typeName << std::endl;
+    }
+    return factory;
+}
+
+// ---------------------------------------------------------------------
+// Timing
+
+struct Timing {
+    std::string backend;
+    size_t classes = 0;
+    size_t attributes = 0;
+    double seconds = 0;
+    size_t allocs = 0;
+};
+
+using ParseFn = std::function<NdrNodeUniquePtr(const NdrNodeDiscoveryResult&)>;
+
+Timing timeBackend(const std::string& backend,
+                   const NdrNodeDiscoveryResultVec& nodes,
+                   size_t attributesPerPass,
+                   int repeat,
+                   const ParseFn& parse)
+{
+    Timing timing;
+    timing.backend = backend;
+    timing.attributes = attributesPerPass * repeat;
+    const size_t allocsBefore = allocCount;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeat; ++i) {
+        for (const NdrNodeDiscoveryResult& node : nodes) {
+            NdrNodeUniquePtr parsed = parse(node);
+            ++timing.classes;
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    timing.seconds = std::chrono::duration<double>(end - start).count();
+    timing.allocs = allocCount - allocsBefore;
+    return timing;
+}
+
+void printTimings(const std::vector<Timing>& timings, size_t bytesPerPass, int repeat)
+{
+    std::cout << std::endl
+              << std::left << std::setw(28) << "backend"
+              << std::right << std::setw(10) << "classes"
+              << std::setw(12) << "time (ms)"
+              << std::setw(12) << "us/class"
+              << std::setw(10) << "MB/s"
+              << std::setw(14) << "allocs/class"
+              << std::setw(13) << "allocs/attr"
+              << std::setw(10) << "speedup" << std::endl;
+    const double megabytes = double(bytesPerPass) * repeat / (1024.0 * 1024.0);
+    for (const Timing& t : timings) {
+        const double classes = t.classes ? double(t.classes) : 1.0;
+        const double attributes = t.attributes ? double(t.attributes) : 1.0;
+        std::cout << std::left << std::setw(28) << t.backend
+                  << std::right << std::setw(10) << t.classes
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << t.seconds * 1e3
+                  << std::setw(12) << t.seconds * 1e6 / classes
+                  << std::setw(10) << (t.seconds > 0 ? megabytes / t.seconds : 0.0)
+                  << std::setw(14) << t.allocs / classes
+                  << std::setw(13) << t.allocs / attributes
+                  << std::setw(9) << (t.seconds > 0 ? timings[0].seconds / t.seconds : 0.0) << "x"
+                  << std::endl;
+    }
+}
+
+// Allocations made by a single parse of a node, per attribute. The JSON
+// DOM costs the same for every backend, so on a large node the difference
+// between backends is mostly down to property construction
+double allocsPerAttribute(const NdrNodeDiscoveryResult& node,
+                          size_t attributes,
+                          const ParseFn& parse)
+{
+    const size_t allocsBefore = allocCount;
+    {
+        NdrNodeUniquePtr parsed = parse(node);
+    }
+    return double(allocCount - allocsBefore) / double(attributes ? attributes : 1);
+}
+
+// Run this program again in a child process with a single flag. The
+// plugins read their settings once per process, so passes that need
+// different settings each get their own process, which inherits the
+// environment set up by the parent
+bool runSelf(const char* prog, const char* arg)
+{
+    std::cout.flush();
+    char* childArgv[] = {const_cast<char*>(prog), const_cast<char*>(arg), nullptr};
+    pid_t pid;
+    int status = 0;
+    return posix_spawnp(&pid, prog, nullptr, nullptr, childArgv, environ) == 0 &&
+        waitpid(pid, &status, 0) >= 0 &&
+        WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// ---------------------------------------------------------------------
+// Cold cache
+
+// Drop a file from the page cache, so that the next read has to go to
+// the filesystem
+void evictFile(const std::string& path)
+{
+#if defined(__linux__)
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+#endif
+}
+
+// Run in a child process with the MOONRAY_CLASS_PREFETCH setting chosen
+// by the parent : time discovery and parsing of every class, the way a
+// render would, and print one row
+int runColdPass()
+{
+    NdrDiscoveryPluginFactoryBase* discoveryFactory =
+        findPluginFactory<NdrDiscoveryPluginFactoryBase>(
+            TfType::Find<NdrDiscoveryPlugin>(), "MoonrayDiscoveryPlugin");
+    NdrParserPluginFactoryBase* parserFactory =
+        findPluginFactory<NdrParserPluginFactoryBase>(
+            TfType::Find<NdrParserPlugin>(), "MoonrayParserPlugin");
+    if (!discoveryFactory || !parserFactory) return -1;
+
+    NdrDiscoveryPluginRefPtr discovery = discoveryFactory->New();
+    std::unique_ptr<NdrParserPlugin> parser(parserFactory->New());
+    TfRefPtr<VerifyDiscoveryContext> context = TfCreateRefPtr(new VerifyDiscoveryContext());
+
+    const auto start = std::chrono::steady_clock::now();
+    const NdrNodeDiscoveryResultVec nodes = discovery->DiscoverNodes(*context);
+    for (const NdrNodeDiscoveryResult& node : nodes) {
+        NdrNodeUniquePtr parsed = parser->Parse(node);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+
+    const char* prefetch = std::getenv("MOONRAY_CLASS_PREFETCH");
+    const double classes = nodes.empty() ? 1.0 : double(nodes.size());
+    std::cout << std::left << std::setw(28)
+              << (std::string("cold, prefetch ") +
+                  (prefetch && std::string(prefetch) == "1" ? "on" : "off"))
+              << std::right << std::setw(10) << nodes.size()
+              << std::fixed << std::setprecision(2)
+              << std::setw(12) << seconds * 1e3
+              << std::setw(12) << seconds * 1e6 / classes << std::endl;
+    return 0;
+}
+
+// Time discovery and parsing from a cold page cache, with prefetching
+// off and then on. Prefetching needs an allowlist, so both passes get
+// one listing every class, and sniffing is turned off so that it does
+// not read the files during discovery
+bool runColdPasses(const char* prog, const NdrNodeDiscoveryResultVec& nodes)
+{
+#if !defined(__linux__)
+    std::cout << "--cold needs posix_fadvise(POSIX_FADV_DONTNEED), skipped." << std::endl;
+    return true;
+#else
+    const std::string allowlist = ArchMakeTmpFileName("sdr_verify_allowlist");
+    {
+        std::ofstream ofs(allowlist);
+        for (const NdrNodeDiscoveryResult& node : nodes) {
+            ofs << node.name << std::endl;
+        }
+    }
+    setenv("MOONRAY_CLASS_ALLOWLIST_FILE", allowlist.c_str(), 1);
+    setenv("MOONRAY_CLASS_SNIFF_CONTEXT", "0", 1);
+
+    std::cout << std::endl
+              << std::left << std::setw(28) << "pass"
+              << std::right << std::setw(10) << "classes"
+              << std::setw(12) << "time (ms)"
+              << std::setw(12) << "us/class" << std::endl;
+
+    bool ok = true;
+    for (const char* prefetch : {"0", "1"}) {
+        setenv("MOONRAY_CLASS_PREFETCH", prefetch, 1);
+        for (const NdrNodeDiscoveryResult& node : nodes) {
+            evictFile(node.resolvedUri);
+        }
+        if (!runSelf(prog, "--cold-pass")) {
+            std::cout << "cold pass with MOONRAY_CLASS_PREFETCH=" << prefetch
+                      << " failed" << std::endl;
+            ok = false;
+        }
+    }
+
+    TfDeleteFile(allowlist);
+    return ok;
+#endif
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string corpusDir;
+    int repeat = 10;
+    bool cold = false;
+    bool sniffPass = false;
+    std::vector<std::string> classDirs;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg == "--write-corpus" && i + 1 < argc) {
+            corpusDir = argv[++i];
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--cold") {
+            cold = true;
+        } else if (arg == "--cold-pass") {
+            return runColdPass();
+        } else if (arg == "--sniff-pass") {
+            sniffPass = true;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            return usage(argv[0]);
+        } else {
+            classDirs.push_back(arg);
+        }
+    }
+
+    if (!corpusDir.empty()) {
+        if (!writeCorpus(corpusDir)) return -1;
+        if (classDirs.empty()) classDirs.push_back(corpusDir);
+    }
+
+    // the discovery plugin reads these when it is created. The nodes
+    // are checked with the default discovery first, then again with
+    // sniffing turned on in a child process (--sniff-pass)
+    if (!classDirs.empty()) {
+        setenv("MOONRAY_CLASS_PATH", TfStringJoin(classDirs, ":").c_str(), 1);
+    }
+    if (!sniffPass) {
+        setenv("MOONRAY_CLASS_SNIFF_CONTEXT", "0", 1);
+    }
+
+    NdrDiscoveryPluginFactoryBase* discoveryFactory =
+        findPluginFactory<NdrDiscoveryPluginFactoryBase>(
+            TfType::Find<NdrDiscoveryPlugin>(), "MoonrayDiscoveryPlugin");
+    NdrParserPluginFactoryBase* parserFactory =
+        findPluginFactory<NdrParserPluginFactoryBase>(
+            TfType::Find<NdrParserPlugin>(), "MoonrayParserPlugin");
+    if (!discoveryFactory || !parserFactory) return -1;
+
+    NdrDiscoveryPluginRefPtr discovery = discoveryFactory->New();
+    std::unique_ptr<NdrParserPlugin> parser(parserFactory->New());
+    TfRefPtr<VerifyDiscoveryContext> context = TfCreateRefPtr(new VerifyDiscoveryContext());
+    const NdrNodeDiscoveryResultVec nodes = discovery->DiscoverNodes(*context);
+    if (nodes.empty()) {
+        std::cout << "No moonray classes found in "
+                  << TfStringJoin(discovery->GetSearchURIs(), ":") << std::endl;
+        return usage(argv[0]);
+    }
+
+    // check every node field by field
+    size_t failedNodes = 0;
+    size_t bytesPerPass = 0;
+    size_t attributesPerPass = 0;
+    const NdrNodeDiscoveryResult* largestNode = nullptr;
+    size_t largestAttributes = 0;
+    size_t invalidNodes = 0;
+    for (const NdrNodeDiscoveryResult& node : nodes) {
+        bytesPerPass += std::max<int64_t>(0, ArchGetFileLength(node.resolvedUri.c_str()));
+
+        Checker checker(node.name);
+        NdrNodeUniquePtr expected = reference::parse(node);
+        NdrNodeUniquePtr actual = parser->Parse(node);
+        compareNodes(expected.get(), actual.get(), &checker);
+        if (!expected->IsValid()) {
+            ++invalidNodes;
+            std::cout << "INVALID " << node.name << " (" << node.resolvedUri << ")" << std::endl;
+            // the generated classes are all valid : if they can't be
+            // parsed, the check itself is broken
+            if (isCorpusClass(node.name)) {
+                checker.check("reference node is valid", true, false);
+            }
+        } else {
+            const size_t attributes = expected->GetInputNames().size();
+            attributesPerPass += attributes;
+            if (attributes > largestAttributes) {
+                largestNode = &node;
+                largestAttributes = attributes;
+            }
+            // the family sniffed at discovery must match the parsed
+            // context, and is left empty by default
+            checker.check("discovered family",
+                          sniffPass ? expected->GetContext() : TfToken(),
+                          node.family);
+        }
+
+        if (!checker.mismatches().empty()) {
+            ++failedNodes;
+            std::cout << "MISMATCH " << node.name << " (" << node.resolvedUri << ")" << std::endl;
+            for (const std::string& mismatch : checker.mismatches()) {
+                std::cout << mismatch << std::endl;
+            }
+        }
+    }
+    std::cout << nodes.size() - failedNodes << " of " << nodes.size()
+              << " classes are identical, " << invalidNodes << " invalid"
+              << (sniffPass ? " with MOONRAY_CLASS_SNIFF_CONTEXT=1" : "") << std::endl;
+    if (sniffPass) {
+        return failedNodes == 0 ? 0 : 1;
+    }
+
+    setenv("MOONRAY_CLASS_SNIFF_CONTEXT", "1", 1);
+    if (!runSelf(argv[0], "--sniff-pass")) {
+        std::cout << "check with MOONRAY_CLASS_SNIFF_CONTEXT=1 failed" << std::endl;
+        failedNodes = std::max<size_t>(failedNodes, 1);
+    }
+
+    // only time the backends once they agree
+    if (failedNodes == 0) {
+        const ParseFn referenceParse = &reference::parse;
+        const ParseFn pluginParse =
+            [&parser](const NdrNodeDiscoveryResult& node) { return parser->Parse(node); };
+
+        std::vector<Timing> timings;
+        timings.push_back(timeBackend("reference (JsParseStream)", nodes,
+                                      attributesPerPass, repeat, referenceParse));
+        timings.push_back(timeBackend("moonrayShaderParser", nodes,
+                                      attributesPerPass, repeat, pluginParse));
+        printTimings(timings, bytesPerPass, repeat);
+
+        if (largestNode) {
+            std::cout << std::endl << "allocations per attribute on " << largestNode->name
+                      << " (" << largestAttributes << " attributes):" << std::endl
+                      << TABSTR << "reference (JsParseStream): "
+                      << allocsPerAttribute(*largestNode, largestAttributes, referenceParse)
+                      << std::endl
+                      << TABSTR << "moonrayShaderParser:       "
+                      << allocsPerAttribute(*largestNode, largestAttributes, pluginParse)
+                      << std::endl;
+        }
+
+        if (cold && !runColdPasses(argv[0], nodes)) {
+            return 1;
+        }
+    }
+
+    return failedNodes == 0 ? 0 : 1;
+}